@@ -0,0 +1,115 @@
+#ifndef CPUS_H
+#define CPUS_H
+
+// The affinity calls here are GNU extensions, so any file that includes
+// this header must #define _GNU_SOURCE before its first #include.
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static inline
+int
+online_cpus()
+{
+    long nn = sysconf(_SC_NPROCESSORS_ONLN);
+    return nn > 0 ? nn : 1;
+}
+
+// Reads a sysfs list like "0-3,8-11" into ids, returns how many.
+static
+int
+parse_cpu_list(FILE* fh, int* ids, int max)
+{
+    int count = 0;
+    int lo, hi;
+
+    while (fscanf(fh, "%d", &lo) == 1) {
+        int ch = fgetc(fh);
+        hi = lo;
+        if (ch == '-') {
+            if (fscanf(fh, "%d", &hi) != 1) {
+                break;
+            }
+            ch = fgetc(fh);
+        }
+
+        for (int ii = lo; ii <= hi && count < max; ++ii) {
+            ids[count++] = ii;
+        }
+
+        if (ch != ',') {
+            break;
+        }
+    }
+
+    return count;
+}
+
+// Lists the CPUs we may run on, grouped by NUMA node so that workers
+// with neighbouring indices land on the same node. Returns the count.
+static
+int
+numa_cpu_order(int* order, int max)
+{
+    cpu_set_t allowed;
+    int nodes[CPU_SETSIZE];
+    int cpus[CPU_SETSIZE];
+    int count = 0;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return 0;
+    }
+
+    FILE* fh = fopen("/sys/devices/system/node/online", "r");
+    if (fh) {
+        int nn = parse_cpu_list(fh, nodes, CPU_SETSIZE);
+        fclose(fh);
+
+        for (int ii = 0; ii < nn; ++ii) {
+            char path[64];
+            snprintf(path, sizeof(path),
+                     "/sys/devices/system/node/node%d/cpulist", nodes[ii]);
+            fh = fopen(path, "r");
+            if (!fh) {
+                continue;
+            }
+            int nc = parse_cpu_list(fh, cpus, CPU_SETSIZE);
+            fclose(fh);
+
+            for (int jj = 0; jj < nc && count < max; ++jj) {
+                int cpu = cpus[jj];
+                if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+                    order[count++] = cpu;
+                    CPU_CLR(cpu, &allowed);
+                }
+            }
+        }
+    }
+
+    // Anything sysfs didn't place, or everything on a non-NUMA kernel.
+    for (int cpu = 0; cpu < CPU_SETSIZE && count < max; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            order[count++] = cpu;
+        }
+    }
+
+    return count;
+}
+
+// Threads created with attr will only run on cpu.
+static
+void
+pin_attr(pthread_attr_t* attr, int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    int rv = pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+    assert(rv == 0);
+}
+
+#endif
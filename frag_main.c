@@ -1,14 +1,23 @@
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <getopt.h>
+#include <pthread.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 
 #include "xmalloc.h"
+#include "cpus.h"
 
 #define SIZE (9 * 1024 * 1024)
 #define LIMIT (16 * 1024 * 1024)
 
+// Worker stacks count against LIMIT, so keep them small.
+#define STACK (256 * 1024)
+
 long
 isqrt_search(long xx, long lo, long hi)
 {
@@ -38,7 +47,22 @@ isqrt(long xx)
     return isqrt_search(xx, 1, xx);
 }
 
-long state = 10;
+// Running out of address space fails the test, rather than crashing
+// on a NULL.
+void*
+checked_xmalloc(size_t bytes)
+{
+    void* ptr = xmalloc(bytes);
+    if (ptr == 0) {
+        fprintf(stderr, "frag: out of memory allocating %ld bytes\n",
+                (long) bytes);
+        exit(1);
+    }
+    return ptr;
+}
+
+// Each thread replays the same sequence of sizes.
+__thread long state = 10;
 
 long
 next_size()
@@ -59,12 +83,12 @@ small_chunks()
 {
     long sum = 0;
 
-    char** xs = xmalloc(512 * sizeof(char*));
+    char** xs = checked_xmalloc(512 * sizeof(char*));
     for (int ii = 0; ii < 512; ++ii) {
         long size = next_size();
         sum += size;
         if (sum < SIZE) {
-            xs[ii] = xmalloc(size);
+            xs[ii] = checked_xmalloc(size);
             memset(xs[ii], 0x99, size);
         }
         else {
@@ -82,23 +106,93 @@ small_chunks()
 void
 big_chunk()
 {
-    char* big = xmalloc(SIZE);
+    char* big = checked_xmalloc(SIZE);
     memset(big, 99, SIZE);
     xfree(big);
 }
 
-int
-main(int _ac, char* _av[])
+void*
+worker(void* _arg)
 {
-    struct rlimit lim;
-    lim.rlim_cur = LIMIT;
-    lim.rlim_max = LIMIT;
-    setrlimit(RLIMIT_AS, &lim);
-
     small_chunks();
     big_chunk();
     small_chunks();
     big_chunk();
+    return 0;
+}
+
+void
+usage(char* prog)
+{
+    printf("Usage:\n");
+    printf("\t%s [-t THREADS] [--pin]\n", prog);
+}
+
+int
+main(int argc, char* argv[])
+{
+    static struct option long_opts[] = {
+        {"pin", no_argument, 0, 'p'},
+        {0, 0, 0, 0}
+    };
+    // One thread unless asked: allocators reserve address space per
+    // thread (glibc maps 64MB per arena), which LIMIT doesn't cover.
+    int threads_n = 1;
+    int pin = 0;
+    int rv;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "t:", long_opts, 0)) != -1) {
+        switch (opt) {
+        case 't':
+            threads_n = atoi(optarg);
+            break;
+        case 'p':
+            pin = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Extra arguments are ignored, like before.
+    if (threads_n < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int cpus_n = 0;
+    int cpus[CPU_SETSIZE];
+    if (pin) {
+        cpus_n = numa_cpu_order(cpus, CPU_SETSIZE);
+    }
+
+    // Every thread gets the same budget a single run used to have.
+    struct rlimit lim;
+    lim.rlim_cur = (rlim_t) LIMIT * threads_n;
+    lim.rlim_max = (rlim_t) LIMIT * threads_n;
+    setrlimit(RLIMIT_AS, &lim);
+
+    pthread_t* threads = checked_xmalloc(threads_n * sizeof(pthread_t));
+    for (int ii = 0; ii < threads_n; ++ii) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, STACK);
+        if (cpus_n > 0) {
+            pin_attr(&attr, cpus[ii % cpus_n]);
+        }
+
+        rv = pthread_create(&(threads[ii]), &attr, worker, 0);
+        assert(rv == 0);
+        pthread_attr_destroy(&attr);
+    }
+
+    for (int ii = 0; ii < threads_n; ++ii) {
+        rv = pthread_join(threads[ii], 0);
+        assert(rv == 0);
+    }
+    xfree(threads);
 
     printf("frag test ok\n");
 
@@ -2,25 +2,55 @@
 #define IVEC_H
 
 #include <assert.h>
+#include <string.h>
 
 #include "xmalloc.h"
 
+// Items this many or fewer are kept in the header itself.
+#define IVEC_INLINE 4
+
+// Buffers this big or bigger grow in whole pages under IVEC_GROW_PAGE.
+#define IVEC_PAGE 4096
+
+// How ivec_push and ivec_reserve pick a new capacity.
+//  - IVEC_GROW_DOUBLE: twice the old one.
+//  - IVEC_GROW_HALF: half as much again, so the freed buffers of
+//    earlier growth add up to enough to be reused by later growth.
+//  - IVEC_GROW_PAGE: doubles while small; from IVEC_PAGE bytes up it
+//    grows by half, rounded up to whole pages.
+typedef enum ivec_growth {
+    IVEC_GROW_DOUBLE = 0,
+    IVEC_GROW_HALF,
+    IVEC_GROW_PAGE,
+} ivec_growth;
+
+static ivec_growth ivec_policy = IVEC_GROW_DOUBLE;
+
+// A small vector is a single allocation: data points at inline_data.
+// It only gets a buffer of its own once it grows past IVEC_INLINE.
 typedef struct ivec {
     long  cap;
     long  size;
     long* data;
+    long  inline_data[IVEC_INLINE];
 } ivec;
 
 static
 ivec*
-make_ivec(int cap0)
+make_ivec(long cap0)
 {
     assert(cap0 > 0);
 
     ivec* xs = xmalloc(sizeof(ivec));
     xs->cap  = cap0;
     xs->size = 0;
-    xs->data = xmalloc(xs->cap * sizeof(long));
+    if (cap0 <= IVEC_INLINE) {
+        xs->cap  = IVEC_INLINE;
+        xs->data = xs->inline_data;
+    }
+    else {
+        xs->data = xmalloc(xs->cap * sizeof(long));
+    }
     return xs;
 }
 
@@ -28,19 +58,89 @@ static
 void
 free_ivec(ivec* xs)
 {
-    xfree(xs->data);
+    if (xs->data != xs->inline_data) {
+        xfree(xs->data);
+    }
     xfree(xs);
 }
 
+static
+long
+ivec_grown_cap(long cap)
+{
+    long bytes = cap * sizeof(long);
+
+    switch (ivec_policy) {
+    case IVEC_GROW_HALF:
+        return cap + cap / 2;
+    case IVEC_GROW_PAGE:
+        if (bytes < IVEC_PAGE) {
+            return 2 * cap;
+        }
+        bytes += bytes / 2;
+        bytes = (bytes + IVEC_PAGE - 1) / IVEC_PAGE * IVEC_PAGE;
+        return bytes / sizeof(long);
+    default:
+        return 2 * cap;
+    }
+}
+
+// Moves the items to a buffer of exactly cap, which must fit them.
 static
 void
-ivec_push(ivec* xs, long item)
+ivec_set_cap(ivec* xs, long cap)
+{
+    assert(cap >= xs->size);
+
+    if (cap <= IVEC_INLINE) {
+        if (xs->data != xs->inline_data) {
+            memcpy(xs->inline_data, xs->data, xs->size * sizeof(long));
+            xfree(xs->data);
+            xs->data = xs->inline_data;
+        }
+        xs->cap = IVEC_INLINE;
+    }
+    else if (xs->data == xs->inline_data) {
+        xs->data = xmalloc(cap * sizeof(long));
+        memcpy(xs->data, xs->inline_data, xs->size * sizeof(long));
+        xs->cap = cap;
+    }
+    else {
+        xs->data = xrealloc(xs->data, cap * sizeof(long));
+        xs->cap = cap;
+    }
+}
+
+// Makes room for at least cap items. Growth still follows ivec_policy,
+// so reserving a little more each time stays amortised.
+static
+void
+ivec_reserve(ivec* xs, long cap)
 {
-    if (xs->size >= xs->cap) {
-        xs->cap *= 2;
-        xs->data = xrealloc(xs->data, xs->cap * sizeof(long));
+    if (cap <= xs->cap) {
+        return;
     }
 
+    long grown = ivec_grown_cap(xs->cap);
+    ivec_set_cap(xs, grown > cap ? grown : cap);
+}
+
+// Gives back any room past the last item.
+static
+void
+ivec_shrink_to_fit(ivec* xs)
+{
+    if (xs->size < xs->cap) {
+        ivec_set_cap(xs, xs->size);
+    }
+}
+
+static
+void
+ivec_push(ivec* xs, long item)
+{
+    ivec_reserve(xs, xs->size + 1);
+
     xs->data[xs->size] = item;
     xs->size += 1;
 }
@@ -52,14 +152,15 @@ ivec_last(ivec* xs)
     return xs->data[xs->size - 1];
 }
 
+// The copy has room for at least cap items, so a caller about to push
+// onto it can copy straight into a buffer of the size it needs.
 static
 ivec*
-ivec_copy(ivec* xs)
+ivec_copy(ivec* xs, long cap)
 {
-    ivec* ys = make_ivec(xs->cap);
-    for (long ii = 0; ii < xs->size; ++ii) {
-        ivec_push(ys, xs->data[ii]);
-    }
+    ivec* ys = make_ivec(cap > xs->size ? cap : xs->size);
+    memcpy(ys->data, xs->data, xs->size * sizeof(long));
+    ys->size = xs->size;
     return ys;
 }
 
@@ -12,29 +12,59 @@
 // To calculate this:
 //  - calculate the entire sequence for each starting value
 //    using multiple threads.
+//  - each thread owns a range of starting values and steals
+//    half of another thread's range when its own runs dry.
+//  - with --stream, skip storing the sequence and just count.
+//  - with --inplace, push onto the sequence itself instead of
+//    onto a copy of it.
+//  - with --growth, pick how the sequences grow: double, half
+//    (1.5x) or page (whole pages once they are big).
+//  - each thread sets up the tasks in its own starting range,
+//    so they come from its allocator arena and its NUMA node.
+//  - each thread keeps the longest sequence it saw, and frees the
+//    sequences it built itself.
 //  - calculate the length of the sequence 
 // Next
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
-#include <pthread.h>
-#include <assert.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
 
-#include "xmalloc.h"
 #include "ivec.h"
 
-#define THREADS 4
+typedef ivec task_val;
+
+#include "tasks.h"
 
-typedef struct num_task {
-    ivec* vals;
-    long  steps;
-    int   dibs;
-    pthread_mutex_t lock;
-} num_task;
+int inplace = 0;
 
-num_task** tasks;
-long data_top = 0;
+void
+init_tasks(long first, long last)
+{
+    for (long ii = first; ii < last; ++ii) {
+        if (!stream) {
+            ivec* xs = make_ivec(4);
+            ivec_push(xs, ii);
+            tasks.vals[ii] = xs;
+        }
+        tasks.steps[ii] = -1;
+        atomic_init(&(tasks.status[ii]), TASK_TODO);
+    }
+}
+
+void
+free_tasks(long first, long last)
+{
+    if (!stream) {
+        for (long ii = first; ii < last; ++ii) {
+            free_ivec(tasks.vals[ii]);
+        }
+    }
+}
 
 long
 collatz_step(long n)
@@ -51,6 +81,7 @@ ivec*
 iterate(ivec* xs)
 {
     long vv = 0;
+    ivec_reserve(xs, xs->size + 50);
     for (int jj = 0; vv != 1 && jj < 50; ++jj) {
         vv = collatz_step(ivec_last(xs));
         ivec_push(xs, vv);
@@ -58,113 +89,100 @@ iterate(ivec* xs)
     return xs;
 }
 
-int
-scan_and_iterate()
+void
+run_task(long ii)
 {
-    long done_count = 0;
-    long base = random() % data_top;
-
-    for (long i0 = 1; i0 < data_top; ++i0) {
-        long ii = 1 + (base + i0) % (data_top - 1);
+    ivec* xs = tasks.vals[ii];
 
-        pthread_mutex_lock(&(tasks[ii]->lock));
-        int skip = tasks[ii]->dibs;
-        if (!skip) {
-            tasks[ii]->dibs = 1;
-        }
-        pthread_mutex_unlock(&(tasks[ii]->lock));
-        if (skip) {
-            continue;
-        }
-
-        ivec* xs = tasks[ii]->vals;
-        long vv = ivec_last(xs);
-
-        if (vv > 1) {
-            xs = ivec_copy(xs);
+    while (ivec_last(xs) > 1) {
+        if (inplace) {
+            // We claimed the task, so nobody else can see xs.
             xs = iterate(xs);
-            free_ivec(tasks[ii]->vals);
-            tasks[ii]->vals = xs;
         }
         else {
-            if (tasks[ii]->steps == -1) {
-                tasks[ii]->steps = tasks[ii]->vals->size - 1;
-            }
-
-            done_count += 1;
+            ivec* ys = iterate(ivec_copy(xs, xs->size + 50));
+            free_ivec(xs);
+            xs = ys;
         }
-
-        pthread_mutex_lock(&(tasks[ii]->lock));
-        tasks[ii]->dibs = 0;
-        pthread_mutex_unlock(&(tasks[ii]->lock));
     }
 
-    return done_count == (data_top - 1);
+    // The sequence is kept until every thread is done.
+    ivec_shrink_to_fit(xs);
+    tasks.vals[ii]  = xs;
+    tasks.steps[ii] = xs->size - 1;
 }
 
-void*
-worker(void* _arg)
+void
+usage(char* prog)
 {
-    int done = 0;
-    while (!done) {
-        done = scan_and_iterate();
-    }
-    return 0;
+    printf("Usage:\n");
+    printf("\t%s [-t THREADS] [--pin] [--stream | --inplace]\n"
+           "\t\t[--growth double|half|page] TOP\n", prog);
 }
 
 int
 main(int argc, char* argv[])
 {
-    pthread_t threads[THREADS];
-    int rv;
-
-    if (argc != 2) {
-        printf("Usage:\n");
-        printf("\t%s TOP\n", argv[0]);
-        return 1;
-    }
-
-    data_top  = atol(argv[1]);
-
-    tasks = xmalloc(data_top * sizeof(num_task*));
-    for (int ii = 0; ii < data_top; ++ii) {
-        tasks[ii] = xmalloc(sizeof(num_task));
-        ivec* xs = make_ivec(4);
-        ivec_push(xs, ii);
-        tasks[ii]->vals  = xs;
-        tasks[ii]->steps = -1;
-        tasks[ii]->dibs  = 0;
-        pthread_mutex_init(&(tasks[ii]->lock), 0);
-    }
-
-    for (int ii = 0; ii < THREADS; ++ii) {
-        rv = pthread_create(&(threads[ii]), 0, worker, 0);
-        assert(rv == 0);
+    static struct option long_opts[] = {
+        {"pin", no_argument, 0, 'p'},
+        {"stream", no_argument, 0, 's'},
+        {"inplace", no_argument, 0, 'i'},
+        {"growth", required_argument, 0, 'g'},
+        {0, 0, 0, 0}
+    };
+    int pin = 0;
+    int opt;
+
+    threads_n = online_cpus();
+
+    while ((opt = getopt_long(argc, argv, "t:", long_opts, 0)) != -1) {
+        switch (opt) {
+        case 't':
+            threads_n = atoi(optarg);
+            break;
+        case 'p':
+            pin = 1;
+            break;
+        case 's':
+            stream = 1;
+            break;
+        case 'i':
+            inplace = 1;
+            break;
+        case 'g':
+            if (strcmp(optarg, "double") == 0) {
+                ivec_policy = IVEC_GROW_DOUBLE;
+            }
+            else if (strcmp(optarg, "half") == 0) {
+                ivec_policy = IVEC_GROW_HALF;
+            }
+            else if (strcmp(optarg, "page") == 0) {
+                ivec_policy = IVEC_GROW_PAGE;
+            }
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
     }
 
-    for (int ii = 0; ii < THREADS; ++ii) {
-        rv = pthread_join(threads[ii], 0);
-        assert(rv == 0);
+    if (optind + 1 != argc || threads_n < 1) {
+        usage(argv[0]);
+        return 1;
     }
 
-    long max_v = 0;
-    long max_s = 0;
+    data_top  = atol(argv[optind]);
 
-    for (int ii = 0; ii < data_top; ++ii) {
-        if (tasks[ii]->steps > max_s) {
-            max_v = ii;
-            max_s = tasks[ii]->steps;
-        }
-    }
+    long max_v;
+    long max_s;
+    run_tasks(pin, &max_v, &max_s);
 
     printf("Max steps is at %ld: %ld steps\n", max_v, max_s);
 
-    for (int ii = 0; ii < data_top; ++ii) {
-        free_ivec(tasks[ii]->vals);
-        xfree(tasks[ii]);
-    }
-    xfree(tasks);
-
     return 0;
 }
 
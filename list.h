@@ -42,16 +42,22 @@ free_list(cell* xs)
     }
 }
 
+// Copies front to back through a tail pointer, so there is no
+// recursion and the new cells are allocated in list order.
 static
 cell*
 copy_list(cell* xs)
 {
-    if (xs == 0) {
-        return 0;
+    cell* ys = 0;
+    cell** tail = &ys;
+
+    while (xs) {
+        *tail = cons(xs->item, 0);
+        tail = &((*tail)->rest);
+        xs = xs->rest;
     }
 
-    cell* ys = copy_list(xs->rest);
-    return cons(xs->item, ys);
+    return ys;
 }
 
 #endif
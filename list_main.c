@@ -12,29 +12,54 @@
 // To calculate this:
 //  - calculate the entire sequence for each starting value
 //    using multiple threads.
+//  - each thread owns a range of starting values and steals
+//    half of another thread's range when its own runs dry.
+//  - with --stream, skip storing the sequence and just count.
+//  - with --share, cons onto the sequence itself instead of
+//    onto a copy of it.
+//  - each thread sets up the tasks in its own starting range,
+//    so they come from its allocator arena and its NUMA node.
+//  - each thread keeps the longest sequence it saw, and frees the
+//    sequences it built itself.
 //  - calculate the length of the sequence 
 // Next
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
-#include <pthread.h>
-#include <assert.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <getopt.h>
 
-#include "xmalloc.h"
 #include "list.h"
 
-#define THREADS 4
+typedef cell task_val;
 
-typedef struct num_task {
-    cell* vals;
-    long  steps;
-    int   dibs;
-    pthread_mutex_t lock;
-} num_task;
+#include "tasks.h"
 
-num_task** tasks;
-long data_top = 0;
+int share = 0;
+
+void
+init_tasks(long first, long last)
+{
+    for (long ii = first; ii < last; ++ii) {
+        if (!stream) {
+            tasks.vals[ii] = cons(ii, 0);
+        }
+        tasks.steps[ii] = -1;
+        atomic_init(&(tasks.status[ii]), TASK_TODO);
+    }
+}
+
+void
+free_tasks(long first, long last)
+{
+    if (!stream) {
+        for (long ii = first; ii < last; ++ii) {
+            free_list(tasks.vals[ii]);
+        }
+    }
+}
 
 long
 collatz_step(long n)
@@ -58,111 +83,82 @@ iterate(cell* xs)
     return xs;
 }
 
-int
-scan_and_iterate()
+void
+run_task(long ii)
 {
-    long done_count = 0;
-    long base = random() % data_top;
-
-    for (long i0 = 1; i0 < data_top; ++i0) {
-        long ii = 1 + (base + i0) % (data_top - 1);
-
-        pthread_mutex_lock(&(tasks[ii]->lock));
-        int skip = tasks[ii]->dibs;
-        if (!skip) {
-            tasks[ii]->dibs = 1;
-        }
-        pthread_mutex_unlock(&(tasks[ii]->lock));
-        if (skip) {
-            continue;
-        }
-
-        cell* xs = tasks[ii]->vals;
-        long vv = xs->item;
+    cell* xs = tasks.vals[ii];
 
-        if (vv > 1) {
-            xs = copy_list(xs);
+    while (xs->item > 1) {
+        if (share) {
+            // Cells never change once consed, so the old list can
+            // simply become the tail of the new one.
             xs = iterate(xs);
-            free_list(tasks[ii]->vals);
-            tasks[ii]->vals = xs;
         }
         else {
-            if (tasks[ii]->steps == -1) {
-                tasks[ii]->steps = count_list(tasks[ii]->vals) - 1;
-            }
-
-            done_count += 1;
+            cell* ys = iterate(copy_list(xs));
+            free_list(xs);
+            xs = ys;
         }
-
-        pthread_mutex_lock(&(tasks[ii]->lock));
-        tasks[ii]->dibs = 0;
-        pthread_mutex_unlock(&(tasks[ii]->lock));
     }
 
-    return done_count == (data_top - 1);
+    tasks.vals[ii]  = xs;
+    tasks.steps[ii] = count_list(xs) - 1;
 }
 
-void*
-worker(void* _arg)
+void
+usage(char* prog)
 {
-    int done = 0;
-    while (!done) {
-        done = scan_and_iterate();
-    }
-    return 0;
+    printf("Usage:\n");
+    printf("\t%s [-t THREADS] [--pin] [--stream | --share] TOP\n", prog);
 }
 
 int
 main(int argc, char* argv[])
 {
-    pthread_t threads[THREADS];
-    int rv;
-
-    if (argc != 2) {
-        printf("Usage:\n");
-        printf("\t%s TOP\n", argv[0]);
-        return 1;
-    }
-
-    data_top  = atol(argv[1]);
-
-    tasks = xmalloc(data_top * sizeof(num_task*));
-    for (int ii = 0; ii < data_top; ++ii) {
-        tasks[ii] = xmalloc(sizeof(num_task));
-        tasks[ii]->vals  = cons(ii, 0);
-        tasks[ii]->steps = -1;
-        tasks[ii]->dibs  = 0;
-        pthread_mutex_init(&(tasks[ii]->lock), 0);
-    }
-
-    for (int ii = 0; ii < THREADS; ++ii) {
-        rv = pthread_create(&(threads[ii]), 0, worker, 0);
-        assert(rv == 0);
+    static struct option long_opts[] = {
+        {"pin", no_argument, 0, 'p'},
+        {"stream", no_argument, 0, 's'},
+        {"share", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    int pin = 0;
+    int opt;
+
+    threads_n = online_cpus();
+
+    while ((opt = getopt_long(argc, argv, "t:", long_opts, 0)) != -1) {
+        switch (opt) {
+        case 't':
+            threads_n = atoi(optarg);
+            break;
+        case 'p':
+            pin = 1;
+            break;
+        case 's':
+            stream = 1;
+            break;
+        case 'h':
+            share = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
     }
 
-    for (int ii = 0; ii < THREADS; ++ii) {
-        rv = pthread_join(threads[ii], 0);
-        assert(rv == 0);
+    if (optind + 1 != argc || threads_n < 1) {
+        usage(argv[0]);
+        return 1;
     }
 
-    long max_v = 0;
-    long max_s = 0;
+    data_top  = atol(argv[optind]);
 
-    for (int ii = 0; ii < data_top; ++ii) {
-        if (tasks[ii]->steps > max_s) {
-            max_v = ii;
-            max_s = tasks[ii]->steps;
-        }
-    }
+    long max_v;
+    long max_s;
+    run_tasks(pin, &max_v, &max_s);
 
     printf("Max steps is at %ld: %ld steps\n", max_v, max_s);
 
-    for (int ii = 0; ii < data_top; ++ii) {
-        free_list(tasks[ii]->vals);
-        xfree(tasks[ii]);
-    }
-    xfree(tasks);
-
     return 0;
 }
 
@@ -0,0 +1,409 @@
+
+
+// The Collatz conjecture:
+//
+// If we start with some number n and iterate the following:
+// - If x is even, n -> n/2
+// - If x is odd,  n -> 3*n + 1
+// We'll eventually get to 1.
+
+// This program searches for the largest number of steps that
+// this takes for numbers from 2 to a provided TOP number.
+
+// Unlike the list and ivec drivers, this one never stores a sequence.
+// Instead:
+//  - threads claim blocks of starting values in ascending order.
+//  - every step count below a bound is kept in a shared cache.
+//  - a trajectory stops as soon as it reaches a value whose
+//    step count is already in the cache.
+//  - optionally, a lookup table on the low bits of a value jumps
+//    many steps at once.
+// Values that outgrow a long are carried on in 128 bits.
+// Cache entries are only ever written with their one correct value,
+// so plain relaxed atomic loads and stores are enough to share them.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <pthread.h>
+#include <assert.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <getopt.h>
+#include <limits.h>
+
+#include "xmalloc.h"
+#include "cpus.h"
+
+// Starting values handed out per claim.
+#define BLOCK 1024
+
+// Largest cache: 2^27 entries of 2 bytes each is 256MB.
+#define MEMO_MAX (1L << 27)
+
+// The shortcut engine jumps this many halving steps per table lookup.
+#define SHORTCUT_BITS 12
+#define SHORTCUT_SIZE (1L << SHORTCUT_BITS)
+
+// Above this, 3*n + 1 doesn't fit in a long.
+#define STEP_MAX ((LONG_MAX - 1) / 3)
+
+typedef unsigned __int128 wide;
+
+#define WIDE_STEP_MAX ((~((wide) 0) - 1) / 3)
+
+typedef struct max_result {
+    long val;
+    long steps;
+} max_result;
+
+// The block of starting values [lo, hi) a thread is working through.
+typedef struct start_block {
+    long lo;
+    long hi;
+} start_block;
+
+// memo[n] is the step count for n, or 0 if not known yet.
+_Atomic unsigned short* memo;
+long memo_top = 0;
+
+typedef enum engine {
+    ENGINE_SCALAR,
+    ENGINE_SHORTCUT,
+} engine;
+
+// Writing n = a * 2^k + b with b the low k bits, the next k steps of
+// the map n -> n/2, n -> (3n + 1)/2 depend only on b, and take n to
+// a * 3^odd[b] + add[b]. Each odd step there is two plain steps.
+unsigned char shortcut_odd[SHORTCUT_SIZE];
+unsigned int  shortcut_add[SHORTCUT_SIZE];
+long          pow3[SHORTCUT_BITS + 1];
+
+atomic_long next_block;
+long data_top = 0;
+engine use_engine = ENGINE_SCALAR;
+
+// Returns 0 if the step doesn't fit in a long.
+long
+collatz_step(long n)
+{
+    if (n % 2 == 0) {
+        return n/2;
+    }
+    else {
+        long next;
+        if (__builtin_mul_overflow(n, 3, &next) ||
+            __builtin_add_overflow(next, 1, &next)) {
+            return 0;
+        }
+        return next;
+    }
+}
+
+long wide_steps(wide n);
+
+long
+count_steps(long n)
+{
+    long steps = 0;
+    while (n != 1) {
+        if (n < memo_top) {
+            long known = atomic_load_explicit(&(memo[n]), memory_order_relaxed);
+            if (known) {
+                return steps + known;
+            }
+        }
+
+        long next = collatz_step(n);
+        if (next == 0) {
+            return steps + 1 + wide_steps(3 * (wide) n + 1);
+        }
+
+        n = next;
+        steps += 1;
+    }
+    return steps;
+}
+
+// Carries a trajectory in 128 bits until it fits in a long again.
+long
+wide_steps(wide n)
+{
+    long steps = 0;
+    while (n > LONG_MAX) {
+        if (n % 2 == 0) {
+            n = n/2;
+        }
+        else {
+            if (n > WIDE_STEP_MAX) {
+                fprintf(stderr, "collatz: trajectory outgrew 128 bits\n");
+                abort();
+            }
+            n = 3*n + 1;
+        }
+        steps += 1;
+    }
+    return steps + count_steps(n);
+}
+
+void
+init_shortcut()
+{
+    pow3[0] = 1;
+    for (int ii = 1; ii <= SHORTCUT_BITS; ++ii) {
+        pow3[ii] = 3 * pow3[ii - 1];
+    }
+
+    for (long bb = 0; bb < SHORTCUT_SIZE; ++bb) {
+        long nn = bb;
+        int odd = 0;
+        for (int ii = 0; ii < SHORTCUT_BITS; ++ii) {
+            if (nn % 2 == 0) {
+                nn = nn/2;
+            }
+            else {
+                nn = (3*nn + 1)/2;
+                odd += 1;
+            }
+        }
+        shortcut_odd[bb] = odd;
+        shortcut_add[bb] = nn;
+    }
+}
+
+// Gives the same count as count_steps. Runs of halvings go in one
+// shift; at or above 2^k a jump can't pass through 1, so we take it.
+long
+shortcut_steps(long n)
+{
+    long steps = 0;
+    while (n != 1) {
+        if (n < memo_top) {
+            long known = atomic_load_explicit(&(memo[n]), memory_order_relaxed);
+            if (known) {
+                return steps + known;
+            }
+        }
+
+        if (n % 2 == 0) {
+            int zeros = __builtin_ctzl(n);
+            n >>= zeros;
+            steps += zeros;
+        }
+        else if (n >= SHORTCUT_SIZE) {
+            long bb = n & (SHORTCUT_SIZE - 1);
+            int odd = shortcut_odd[bb];
+            long next;
+            if (__builtin_mul_overflow(n >> SHORTCUT_BITS, pow3[odd], &next) ||
+                __builtin_add_overflow(next, shortcut_add[bb], &next)) {
+                return steps + count_steps(n);
+            }
+            n = next;
+            steps += SHORTCUT_BITS + odd;
+        }
+        else {
+            n = collatz_step(n);
+            steps += 1;
+        }
+    }
+    return steps;
+}
+
+// Returns the next starting value for this thread, claiming a fresh
+// block once the current one is used up, or -1 when none are left.
+long
+take_start(start_block* bb)
+{
+    if (bb->lo >= bb->hi) {
+        bb->lo = atomic_fetch_add(&next_block, BLOCK);
+        if (bb->lo >= data_top) {
+            return -1;
+        }
+
+        bb->hi = bb->lo + BLOCK;
+        if (bb->hi > data_top) {
+            bb->hi = data_top;
+        }
+    }
+
+    bb->lo += 1;
+    return bb->lo - 1;
+}
+
+void
+record(max_result* best, long nn, long steps)
+{
+    if (nn < memo_top) {
+        atomic_store_explicit(&(memo[nn]), steps, memory_order_relaxed);
+    }
+
+    // Ties go to the smaller value, same as a serial scan.
+    if (steps > best->steps ||
+        (steps == best->steps && nn < best->val)) {
+        best->val   = nn;
+        best->steps = steps;
+    }
+}
+
+void
+scalar_worker(max_result* best, long (*count)(long))
+{
+    start_block bb = {0, 0};
+    long nn;
+
+    while ((nn = take_start(&bb)) != -1) {
+        record(best, nn, count(nn));
+    }
+}
+
+void*
+worker(void* arg)
+{
+    max_result* best = (max_result*) arg;
+
+    switch (use_engine) {
+    case ENGINE_SCALAR:
+        scalar_worker(best, count_steps);
+        break;
+    case ENGINE_SHORTCUT:
+        scalar_worker(best, shortcut_steps);
+        break;
+    }
+
+    return 0;
+}
+
+void
+usage(char* prog)
+{
+    printf("Usage:\n");
+    printf("\t%s [-t THREADS] [--pin] [--scalar | --shortcut] TOP\n", prog);
+    printf("\t%s [--scalar | --shortcut] --steps N\n", prog);
+}
+
+int
+main(int argc, char* argv[])
+{
+    static struct option long_opts[] = {
+        {"pin", no_argument, 0, 'p'},
+        {"scalar", no_argument, 0, 's'},
+        {"steps", required_argument, 0, 'n'},
+        {"shortcut", no_argument, 0, 'k'},
+        {0, 0, 0, 0}
+    };
+    int threads_n = online_cpus();
+    int pin = 0;
+    long one = 0;
+    int rv;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "t:", long_opts, 0)) != -1) {
+        switch (opt) {
+        case 't':
+            threads_n = atoi(optarg);
+            break;
+        case 'p':
+            pin = 1;
+            break;
+        case 's':
+            use_engine = ENGINE_SCALAR;
+            break;
+        case 'n':
+            one = atol(optarg);
+            break;
+        case 'k':
+            use_engine = ENGINE_SHORTCUT;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (one > 0 && optind == argc) {
+        // Just one value, with an empty cache. This reaches values the
+        // cache can't, like ones whose trajectory outgrows a long.
+        memo = xmalloc(sizeof(unsigned short));
+        memo[0] = 0;
+        memo_top = 1;
+        if (use_engine == ENGINE_SHORTCUT) {
+            init_shortcut();
+        }
+        long steps = use_engine == ENGINE_SHORTCUT ?
+            shortcut_steps(one) : count_steps(one);
+        printf("%ld: %ld steps\n", one, steps);
+        xfree(memo);
+        return 0;
+    }
+
+    if (optind + 1 != argc || threads_n < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    data_top = atol(argv[optind]);
+
+    memo_top = data_top < MEMO_MAX ? data_top : MEMO_MAX;
+    if (memo_top < 1) {
+        memo_top = 1;
+    }
+    memo = xmalloc(memo_top * sizeof(unsigned short));
+    memset(memo, 0, memo_top * sizeof(unsigned short));
+
+    if (use_engine == ENGINE_SHORTCUT) {
+        init_shortcut();
+    }
+
+    // Value 0 never reaches 1, so like the other drivers we start at 1.
+    atomic_init(&next_block, 1);
+
+    int cpus_n = 0;
+    int* cpus = xmalloc(CPU_SETSIZE * sizeof(int));
+    if (pin) {
+        cpus_n = numa_cpu_order(cpus, CPU_SETSIZE);
+    }
+
+    pthread_t* threads = xmalloc(threads_n * sizeof(pthread_t));
+    max_result* results = xmalloc(threads_n * sizeof(max_result));
+    for (int ii = 0; ii < threads_n; ++ii) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (cpus_n > 0) {
+            pin_attr(&attr, cpus[ii % cpus_n]);
+        }
+
+        results[ii].val   = 0;
+        results[ii].steps = 0;
+        rv = pthread_create(&(threads[ii]), &attr, worker, &(results[ii]));
+        assert(rv == 0);
+        pthread_attr_destroy(&attr);
+    }
+
+    for (int ii = 0; ii < threads_n; ++ii) {
+        rv = pthread_join(threads[ii], 0);
+        assert(rv == 0);
+    }
+
+    long max_v = 0;
+    long max_s = 0;
+
+    // Ties go to the smallest value, same as a serial scan.
+    for (int ii = 0; ii < threads_n; ++ii) {
+        if (results[ii].steps > max_s ||
+            (results[ii].steps == max_s && results[ii].val < max_v)) {
+            max_v = results[ii].val;
+            max_s = results[ii].steps;
+        }
+    }
+
+    printf("Max steps is at %ld: %ld steps\n", max_v, max_s);
+
+    xfree(results);
+    xfree(threads);
+    xfree(cpus);
+    xfree(memo);
+
+    return 0;
+}
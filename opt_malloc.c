@@ -32,33 +32,13 @@ typedef struct arena {
     pthread_mutex_t lock;
 } arena;
 
-// Our data structure is a 
-
-pthread_mutex_t initialize_lock = PTHREAD_MUTEX_INITIALIZER;
-
-static arena arenas[ARENAS];
-int initialized_arenas = 0;
+// The locks are set up statically, so xmalloc never has to check that
+// the arenas are ready.
+static arena arenas[ARENAS] = {
+    [0 ... ARENAS - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
 __thread int threads_favorite_arena_index = 0;
 
-/**
- * Initialize the arenas if necessary.
- */
-void initialize_arenas() {
-    if (!initialized_arenas) {
-        pthread_mutex_lock(&initialize_lock);
-        // We wake up. We might actually be initialized now.
-        if (initialized_arenas) {
-            pthread_mutex_unlock(&initialize_lock);
-            return;
-        }
-        for (int i = 0; i < ARENAS; i++) {
-            pthread_mutex_init(&(arenas[i].lock), NULL);
-        }
-        initialized_arenas = 1;
-        pthread_mutex_unlock(&initialize_lock);
-    }
-}
-
 const int PAGE_SIZE = 4096;
 
 /**
@@ -101,7 +81,6 @@ block* NON_BUCKET_RESERVED = (block*) 1;
 void* xmalloc(size_t bytes) {
     assert(bytes < INT_MAX); // TODO: Remove for optimization/
     
-    initialize_arenas();
     // We change bytes to be representative of the block size we will need to store.
     bytes += sizeof(block);
     
@@ -0,0 +1,338 @@
+#ifndef TASKS_H
+#define TASKS_H
+
+// The task table and work-stealing scheduler shared by the list, ivec
+// and ulist drivers. Task ii computes the sequence for starting value ii.
+//
+// A driver includes this once, after defining _GNU_SOURCE (for cpus.h)
+// and typedef-ing task_val to its sequence type. It then supplies:
+//  - collatz_step(n), one step of the map.
+//  - init_tasks(first, last), which sets up tasks [first, last).
+//  - free_tasks(first, last), which frees what they hold.
+//  - run_task(ii), which computes the sequence for task ii.
+
+#include <stdio.h>
+#include <pthread.h>
+#include <assert.h>
+#include <stdatomic.h>
+
+#include "xmalloc.h"
+#include "cpus.h"
+
+// Tasks a thread takes from its own range at a time.
+#define BATCH 64
+
+typedef enum task_status {
+    TASK_TODO = 0,
+    TASK_RUNNING,
+    TASK_DONE,
+} task_status;
+
+// Task ii is vals[ii], steps[ii] and status[ii]. A thread owns a task
+// once it moves its status from TODO to RUNNING. In stream mode there
+// are no sequences, and vals is 0.
+typedef struct task_table {
+    task_val** vals;
+    long*      steps;
+    _Atomic unsigned char* status;
+} task_table;
+
+// The starting values [lo, hi) that a thread has yet to run.
+// The owner takes from the bottom, thieves take from the top. Only the
+// owner writes lo; thieves move hi down with a compare-and-swap. The
+// two ends can briefly cross, which just means the same value gets
+// offered twice, and claim_task lets only one thread run it.
+typedef struct task_range {
+    atomic_long lo;
+    atomic_long hi;
+} task_range;
+
+// What a thread is started with: its index, and the tasks
+// [first, last) that it sets up. It hands back the task with the most
+// steps among those it ran. The tasks it ran, stolen ones included,
+// are kept as [lo, hi) pairs in ran[0 .. 2 * ran_n).
+typedef struct worker_args {
+    int   self;
+    long  first;
+    long  last;
+    long  max_v;
+    long  max_s;
+    long* ran;
+    long  ran_n;
+    long  ran_cap;
+} worker_args;
+
+static task_table tasks;
+static task_range* ranges;
+static pthread_barrier_t tasks_ready;
+
+// Tasks that haven't finished yet. A thread stops looking for work to
+// steal as soon as this reaches zero.
+static atomic_long tasks_left;
+static int threads_n = 0;
+static long data_top = 0;
+static int stream = 0;
+
+long collatz_step(long n);
+void init_tasks(long first, long last);
+void free_tasks(long first, long last);
+void run_task(long ii);
+
+// Stream mode: only the current value and the count are kept.
+static
+void
+stream_task(long ii)
+{
+    long vv = ii;
+    long steps = 0;
+
+    while (vv > 1) {
+        vv = collatz_step(vv);
+        steps += 1;
+    }
+
+    tasks.steps[ii] = steps;
+}
+
+static
+int
+claim_task(long ii)
+{
+    unsigned char todo = TASK_TODO;
+    return atomic_compare_exchange_strong_explicit(
+        &(tasks.status[ii]), &todo, TASK_RUNNING,
+        memory_order_acquire, memory_order_relaxed);
+}
+
+// Takes up to BATCH tasks off the bottom of our range with a single
+// fetch-add. Returns how many, the first being *first.
+static
+long
+take_tasks(int self, long* first)
+{
+    task_range* rr = &(ranges[self]);
+
+    long lo = atomic_fetch_add_explicit(&(rr->lo), BATCH, memory_order_relaxed);
+    long hi = atomic_load_explicit(&(rr->hi), memory_order_acquire);
+    if (lo >= hi) {
+        return 0;
+    }
+
+    *first = lo;
+    return hi - lo < BATCH ? hi - lo : BATCH;
+}
+
+static
+int
+steal_tasks(int self)
+{
+    task_range* rr = &(ranges[self]);
+
+    for (int jj = 1; jj < threads_n; ++jj) {
+        task_range* victim = &(ranges[(self + jj) % threads_n]);
+
+        long lo = atomic_load_explicit(&(victim->lo), memory_order_relaxed);
+        long hi = atomic_load_explicit(&(victim->hi), memory_order_acquire);
+        while (lo < hi) {
+            long mid = hi - (hi - lo + 1) / 2;
+            if (atomic_compare_exchange_weak_explicit(
+                    &(victim->hi), &hi, mid,
+                    memory_order_acq_rel, memory_order_acquire)) {
+                // Publish [mid, hi) as empty first, then open it up.
+                atomic_store_explicit(&(rr->lo), hi, memory_order_relaxed);
+                atomic_store_explicit(&(rr->hi), hi, memory_order_release);
+                atomic_store_explicit(&(rr->lo), mid, memory_order_release);
+                return 1;
+            }
+            lo = atomic_load_explicit(&(victim->lo), memory_order_relaxed);
+        }
+    }
+
+    return 0;
+}
+
+// Adds task ii to the tasks we ran. We mostly run a batch in order,
+// so it usually just extends the last pair.
+static
+void
+note_ran(worker_args* args, long ii)
+{
+    long nn = args->ran_n;
+    if (nn > 0 && args->ran[2 * nn - 1] == ii) {
+        args->ran[2 * nn - 1] = ii + 1;
+        return;
+    }
+
+    if (nn == args->ran_cap) {
+        args->ran_cap = args->ran_cap ? 2 * args->ran_cap : 16;
+        args->ran = xrealloc(args->ran, 2 * args->ran_cap * sizeof(long));
+    }
+
+    args->ran[2 * nn] = ii;
+    args->ran[2 * nn + 1] = ii + 1;
+    args->ran_n = nn + 1;
+}
+
+// Runs task ii unless another thread got to it first.
+// Returns 1 if we ran it.
+static
+int
+run_claimed(worker_args* args, long ii)
+{
+    if (!claim_task(ii)) {
+        return 0;
+    }
+
+    if (stream) {
+        stream_task(ii);
+    }
+    else {
+        run_task(ii);
+        note_ran(args, ii);
+    }
+
+    atomic_store_explicit(&(tasks.status[ii]), TASK_DONE,
+                          memory_order_release);
+
+    // Stolen ranges come out of order, so ties go to the smaller value.
+    long steps = tasks.steps[ii];
+    if (steps > args->max_s ||
+        (steps == args->max_s && ii < args->max_v)) {
+        args->max_v = ii;
+        args->max_s = steps;
+    }
+
+    return 1;
+}
+
+static
+void*
+worker(void* arg)
+{
+    worker_args* args = (worker_args*) arg;
+    int self = args->self;
+
+    // Nobody may steal a task before it has been set up.
+    init_tasks(args->first, args->last);
+    pthread_barrier_wait(&tasks_ready);
+
+    do {
+        long first;
+        long count;
+        long finished = 0;
+        while ((count = take_tasks(self, &first)) > 0) {
+            for (long ii = first; ii < first + count; ++ii) {
+                finished += run_claimed(args, ii);
+            }
+        }
+
+        // One update per drained range keeps the counter off the hot path.
+        atomic_fetch_sub(&tasks_left, finished);
+    } while (atomic_load(&tasks_left) > 0 && steal_tasks(self));
+
+    // Free the sequences we built, wherever they came from, so each
+    // goes back to the arena it was allocated from. No other thread
+    // touches them.
+    for (long jj = 0; jj < args->ran_n; ++jj) {
+        free_tasks(args->ran[2 * jj], args->ran[2 * jj + 1]);
+    }
+    if (args->ran) {
+        xfree(args->ran);
+    }
+
+    return 0;
+}
+
+// Runs tasks 1 to data_top - 1 on threads_n threads, optionally pinned,
+// and frees them. Hands back the value with the most steps.
+static
+void
+run_tasks(int pin, long* max_v, long* max_s)
+{
+    int rv;
+
+    // The arrays are left untouched here, so that each page is first
+    // touched by the thread that sets up the tasks on it.
+    tasks.vals   = 0;
+    tasks.steps  = xmalloc(data_top * sizeof(long));
+    tasks.status = xmalloc(data_top * sizeof(unsigned char));
+    if (!stream) {
+        tasks.vals = xmalloc(data_top * sizeof(task_val*));
+    }
+
+    // Value 0 never reaches 1, so we start at 1.
+    if (data_top > 0) {
+        init_tasks(0, 1);
+    }
+
+    ranges = xmalloc(threads_n * sizeof(task_range));
+    worker_args* args = xmalloc(threads_n * sizeof(worker_args));
+    for (int ii = 0; ii < threads_n; ++ii) {
+        args[ii].self  = ii;
+        args[ii].first = 1 + (data_top - 1) * ii / threads_n;
+        args[ii].last  = 1 + (data_top - 1) * (ii + 1) / threads_n;
+        args[ii].max_v = 0;
+        args[ii].max_s = 0;
+        args[ii].ran     = 0;
+        args[ii].ran_n   = 0;
+        args[ii].ran_cap = 0;
+        atomic_init(&(ranges[ii].lo), args[ii].first);
+        atomic_init(&(ranges[ii].hi), args[ii].last);
+    }
+
+    rv = pthread_barrier_init(&tasks_ready, 0, threads_n);
+    assert(rv == 0);
+    atomic_init(&tasks_left, data_top > 1 ? data_top - 1 : 0);
+
+    int cpus_n = 0;
+    int* cpus = xmalloc(CPU_SETSIZE * sizeof(int));
+    if (pin) {
+        cpus_n = numa_cpu_order(cpus, CPU_SETSIZE);
+    }
+
+    pthread_t* threads = xmalloc(threads_n * sizeof(pthread_t));
+    for (int ii = 0; ii < threads_n; ++ii) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (cpus_n > 0) {
+            pin_attr(&attr, cpus[ii % cpus_n]);
+        }
+
+        rv = pthread_create(&(threads[ii]), &attr, worker, &(args[ii]));
+        assert(rv == 0);
+        pthread_attr_destroy(&attr);
+    }
+
+    for (int ii = 0; ii < threads_n; ++ii) {
+        rv = pthread_join(threads[ii], 0);
+        assert(rv == 0);
+    }
+    pthread_barrier_destroy(&tasks_ready);
+
+    *max_v = 0;
+    *max_s = 0;
+
+    for (int ii = 0; ii < threads_n; ++ii) {
+        if (args[ii].max_s > *max_s ||
+            (args[ii].max_s == *max_s && args[ii].max_v < *max_v)) {
+            *max_v = args[ii].max_v;
+            *max_s = args[ii].max_s;
+        }
+    }
+
+    // The threads freed everything but task 0.
+    if (data_top > 0) {
+        free_tasks(0, 1);
+    }
+    if (tasks.vals) {
+        xfree(tasks.vals);
+    }
+    xfree(tasks.steps);
+    xfree(tasks.status);
+    xfree(args);
+    xfree(threads);
+    xfree(cpus);
+    xfree(ranges);
+}
+
+#endif
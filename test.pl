@@ -4,7 +4,7 @@ use warnings FATAL => 'all';
 use POSIX ":sys_wait_h";
 
 use Time::HiRes qw(time);
-use Test::Simple tests => 14;
+use Test::Simple tests => 33;
 
 sub crc_check {
     my ($file, $expect) = @_;
@@ -15,9 +15,9 @@ sub crc_check {
     }
 }
 
-crc_check("ivec_main.c", "cae7f5aa");
-crc_check("list_main.c", "0ae6f792");
-crc_check("frag_main.c", "d8d3af29");
+crc_check("ivec_main.c", "671d772d");
+crc_check("list_main.c", "8a9b342b");
+crc_check("frag_main.c", "d6df7896");
 
 sub get_time {
     my $data = `cat time.tmp | grep ^real`;
@@ -47,6 +47,16 @@ ok($hw7_l =~ /at 97: 118 steps/, "list-hwx 100");
 my $hw7_v = run_prog("collatz-ivec-hwx", 100);
 ok($hw7_v =~ /at 97: 118 steps/, "ivec-hwx 100");
 
+$hw7_v = run_prog("collatz-ivec-hwx", 500000);
+ok($hw7_v =~ /at 410011: 448 steps/, "ivec-hwx 500k");
+
+my $tlsf_v = run_prog("collatz-ivec-tlsf", 500000);
+ok($tlsf_v =~ /at 410011: 448 steps/, "ivec-tlsf 500k");
+
+# New regions should mostly extend the last one in place.
+my $hwx_stats = `XV6_STATS=1 ./collatz-list-hwx 10000 2>&1 >/dev/null`;
+ok($hwx_stats =~ /, (\d+) extended/ && $1 > 0, "hwx extends regions");
+
 my $par_v = run_prog("collatz-ivec-opt", 1000);
 my $pv_ok = $par_v =~ /at 871: 178 steps/;
 ok($pv_ok, "ivec-par 1k");
@@ -71,6 +81,55 @@ $par_l = run_prog("collatz-list-opt", 500000);
 $pl_ok = $par_l =~ /at 410011: 448 steps/;
 ok($pl_ok, "list-opt 500k");
 
+$par_v = run_prog("collatz-ivec-opt", "--stream 500000");
+ok($par_v =~ /at 410011: 448 steps/, "ivec-opt stream 500k");
+
+$par_l = run_prog("collatz-list-opt", "--stream 500000");
+ok($par_l =~ /at 410011: 448 steps/, "list-opt stream 500k");
+
+$par_l = run_prog("collatz-list-opt", "--share 500000");
+ok($par_l =~ /at 410011: 448 steps/, "list-opt share 500k");
+
+$par_v = run_prog("collatz-ivec-opt", "--inplace 500000");
+ok($par_v =~ /at 410011: 448 steps/, "ivec-opt inplace 500k");
+
+$par_v = run_prog("collatz-ivec-opt", "--growth half 500000");
+ok($par_v =~ /at 410011: 448 steps/, "ivec-opt growth half 500k");
+
+$par_v = run_prog("collatz-ivec-opt", "--growth page 500000");
+ok($par_v =~ /at 410011: 448 steps/, "ivec-opt growth page 500k");
+
+my $memo_s = run_prog("collatz-memo-sys", 1000);
+ok($memo_s =~ /at 871: 178 steps/, "memo-sys 1k");
+
+my $memo_h = run_prog("collatz-memo-hwx", 100);
+ok($memo_h =~ /at 97: 118 steps/, "memo-hwx 100");
+
+my $memo_o = run_prog("collatz-memo-opt", 500000);
+ok($memo_o =~ /at 410011: 448 steps/, "memo-opt 500k");
+
+$memo_o = run_prog("collatz-memo-opt", "--scalar 500000");
+ok($memo_o =~ /at 410011: 448 steps/, "memo-opt scalar 500k");
+
+$memo_o = run_prog("collatz-memo-opt", "--shortcut 500000");
+ok($memo_o =~ /at 410011: 448 steps/, "memo-opt shortcut 500k");
+
+# This trajectory goes past 2^64, so it needs the 128-bit path.
+my $wide = run_prog("collatz-memo-opt", "--steps 1980976057694848447");
+ok($wide =~ /: 1475 steps/, "memo 128-bit trajectory");
+
+$wide = run_prog("collatz-memo-opt", "--shortcut --steps 1980976057694848447");
+ok($wide =~ /: 1475 steps/, "memo shortcut 128-bit trajectory");
+
+my $ulist_s = run_prog("collatz-ulist-sys", 1000);
+ok($ulist_s =~ /at 871: 178 steps/, "ulist-sys 1k");
+
+my $ulist_h = run_prog("collatz-ulist-hwx", 100);
+ok($ulist_h =~ /at 97: 118 steps/, "ulist-hwx 100");
+
+my $ulist_o = run_prog("collatz-ulist-opt", 500000);
+ok($ulist_o =~ /at 410011: 448 steps/, "ulist-opt 500k");
+
 my $fragt = run_prog("frag-opt", 1);
 my $ft_ok = $fragt =~ /frag test ok/;
 ok($ft_ok, "fragmentation test");
@@ -0,0 +1,89 @@
+#ifndef ULIST_H
+#define ULIST_H
+
+#include <string.h>
+
+#include "xmalloc.h"
+
+// Items per node; 14 makes a node exactly 128 bytes.
+#define ULIST_ITEMS 14
+
+// Unrolled linked list node. Items are kept oldest first, so the head
+// of the list is the last item of the first node.
+typedef struct ulist {
+    long          size;
+    long          items[ULIST_ITEMS];
+    struct ulist* rest;
+} ulist;
+
+// Unlike cons, this fills the first node in place while it has room,
+// so it must only be used on a list the caller owns.
+static
+ulist*
+ucons(long item, ulist* rest)
+{
+    if (rest && rest->size < ULIST_ITEMS) {
+        rest->items[rest->size] = item;
+        rest->size += 1;
+        return rest;
+    }
+
+    ulist* xs = xmalloc(sizeof(ulist));
+    xs->size = 1;
+    xs->items[0] = item;
+    xs->rest = rest;
+    return xs;
+}
+
+static
+long
+ulist_first(ulist* xs)
+{
+    return xs->items[xs->size - 1];
+}
+
+static
+long
+count_ulist(ulist* xs)
+{
+    long nn = 0;
+    while (xs) {
+        nn += xs->size;
+        xs = xs->rest;
+    }
+    return nn;
+}
+
+static
+void
+free_ulist(ulist* xs)
+{
+    while (xs) {
+        ulist* ys = xs->rest;
+        xfree(xs);
+        xs = ys;
+    }
+}
+
+static
+ulist*
+copy_ulist(ulist* xs)
+{
+    ulist* ys = 0;
+    ulist** tail = &ys;
+
+    while (xs) {
+        ulist* zs = xmalloc(sizeof(ulist));
+        zs->size = xs->size;
+        memcpy(zs->items, xs->items, xs->size * sizeof(long));
+        zs->rest = 0;
+
+        *tail = zs;
+        tail = &(zs->rest);
+        xs = xs->rest;
+    }
+
+    return ys;
+}
+
+#endif
@@ -0,0 +1,149 @@
+
+// The Collatz conjecture:
+//
+// If we start with some number n and iterate the following:
+// - If x is even, n -> n/2
+// - If x is odd,  n -> 3*n + 1
+// We'll eventually get to 1.
+
+// This program searches for the largest number of steps that
+// this takes for numbers from 2 to a provided TOP number.
+
+// To calculate this:
+//  - calculate the entire sequence for each starting value
+//    using multiple threads, storing it in an unrolled list.
+//  - each thread owns a range of starting values and steals
+//    half of another thread's range when its own runs dry.
+//  - with --stream, skip storing the sequence and just count.
+//  - each thread sets up the tasks in its own starting range,
+//    so they come from its allocator arena and its NUMA node.
+//  - each thread keeps the longest sequence it saw, and frees the
+//    sequences it built itself.
+//  - calculate the length of the sequence 
+// Next
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "ulist.h"
+
+typedef ulist task_val;
+
+#include "tasks.h"
+
+void
+init_tasks(long first, long last)
+{
+    for (long ii = first; ii < last; ++ii) {
+        if (!stream) {
+            tasks.vals[ii] = ucons(ii, 0);
+        }
+        tasks.steps[ii] = -1;
+        atomic_init(&(tasks.status[ii]), TASK_TODO);
+    }
+}
+
+void
+free_tasks(long first, long last)
+{
+    if (!stream) {
+        for (long ii = first; ii < last; ++ii) {
+            free_ulist(tasks.vals[ii]);
+        }
+    }
+}
+
+long
+collatz_step(long n)
+{
+    if (n % 2 == 0) {
+        return n/2;
+    }
+    else {
+        return 3*n + 1;
+    }
+}
+
+ulist*
+iterate(ulist* xs)
+{
+    long vv = 0;
+    for (int jj = 0; vv != 1 && jj < 50; ++jj) {
+        vv = collatz_step(ulist_first(xs));
+        xs = ucons(vv, xs);
+    }
+    return xs;
+}
+
+void
+run_task(long ii)
+{
+    ulist* xs = tasks.vals[ii];
+
+    while (ulist_first(xs) > 1) {
+        ulist* ys = iterate(copy_ulist(xs));
+        free_ulist(xs);
+        xs = ys;
+    }
+
+    tasks.vals[ii]  = xs;
+    tasks.steps[ii] = count_ulist(xs) - 1;
+}
+
+void
+usage(char* prog)
+{
+    printf("Usage:\n");
+    printf("\t%s [-t THREADS] [--pin] [--stream] TOP\n", prog);
+}
+
+int
+main(int argc, char* argv[])
+{
+    static struct option long_opts[] = {
+        {"pin", no_argument, 0, 'p'},
+        {"stream", no_argument, 0, 's'},
+        {0, 0, 0, 0}
+    };
+    int pin = 0;
+    int opt;
+
+    threads_n = online_cpus();
+
+    while ((opt = getopt_long(argc, argv, "t:", long_opts, 0)) != -1) {
+        switch (opt) {
+        case 't':
+            threads_n = atoi(optarg);
+            break;
+        case 'p':
+            pin = 1;
+            break;
+        case 's':
+            stream = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind + 1 != argc || threads_n < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    data_top  = atol(argv[optind]);
+
+    long max_v;
+    long max_s;
+    run_tasks(pin, &max_v, &max_s);
+
+    printf("Max steps is at %ld: %ld steps\n", max_v, max_s);
+
+    return 0;
+}
+
@@ -4,6 +4,7 @@
 #include <string.h>
 
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "xmalloc.h"
 
@@ -14,104 +15,448 @@
 //
 // Then modified to use mmap and add a mutex by Nat Tuck, becoming starter code
 // for CS3650 Spring 2020.
+//
+// Then moved from one address-ordered free list to size-segregated bins
+// with boundary tags, after Doug Lea's malloc. Built with -DTLSF, it
+// finds free chunks in constant time instead of by first fit.
+//
+// Then split into NHEAPS heaps with a lock each. A thread allocates from
+// one heap, and a chunk goes back to the heap it came from when freed.
+//
+// Then made to map regions of growing size, extending the last region in
+// place when the kernel allows, and to give large requests a mapping of
+// their own that is unmapped when freed. Linux hands out mappings top
+// down, so a region is extended at its low end. With XV6_STATS set in
+// the environment, the number of regions mapped and extended is printed
+// at exit.
+//
+// Then made to give memory back: a region that is all one free chunk is
+// unmapped, and the whole pages inside a large free chunk are dropped.
+
+// Every chunk starts with its size. The low bits of the size say whether
+// the chunk and the one just before it are in use, and which heap the
+// chunk belongs to. A free chunk also leaves its size in the prev_size
+// field of the chunk after it, so both neighbours of a freed chunk are
+// found without walking any list. A chunk with a mapping of its own has
+// no heap neighbours, and says so with MMAPPED in prev_size. The first
+// chunk in a region has FIRST there instead.
+typedef struct chunk {
+  size_t prev_size;     // size of the chunk before, if that one is free
+  size_t head;          // size of this chunk | CINUSE | PINUSE | heap
+  struct chunk *next;   // bin links, only while free
+  struct chunk *prev;
+} Chunk;
+
+#define CINUSE   1
+#define PINUSE   2
+#define HEAPBITS 12
+#define FLAGS    (CINUSE|PINUSE|HEAPBITS)
+#define MMAPPED  1
+#define FIRST    2
+
+// Sizes are multiples of ALIGN, so only two bits are left for the heap.
+#define NHEAPS   4
+
+#define ALIGN    16
+#define HDR      offsetof(Chunk, next)
+#define MINSIZE  sizeof(Chunk)
+#define PAGE     4096
+
+// Heap regions start at MINGROW bytes and double up to MAXGROW. Requests
+// of MMAPMIN bytes or more are mapped on their own. Free chunks with at
+// least TRIMMIN bytes of whole pages have those pages dropped.
+#define MINGROW  (PAGE * 16)
+#define MAXGROW  (1024 * 1024)
+#define MMAPMIN  (256 * 1024)
+#define TRIMMIN  (PAGE * 16)
+
+// Bins below NSMALL hold chunks of exactly bin * ALIGN bytes. Above
+// that, each power of two range of sizes is split into NSUB bins, as in
+// TLSF (Masmano et al., 2004).
+#define NSMALL   32
+#define SUBBITS  3
+#define NSUB     (1 << SUBBITS)
+#define NBINS    (NSMALL + (64 - 9) * NSUB)
+#define NWORDS   ((NBINS + 63) / 64)
+
+#define chunksize(c)   ((c)->head & ~(size_t)FLAGS)
+#define next_chunk(c)  ((Chunk*)((char*)(c) + chunksize(c)))
+#define prev_chunk(c)  ((Chunk*)((char*)(c) - (c)->prev_size))
+#define chunk2mem(c)   ((void*)((char*)(c) + HDR))
+#define mem2chunk(p)   ((Chunk*)((char*)(p) - HDR))
+#define is_mmapped(c)  (!((c)->head & PINUSE) && ((c)->prev_size & MMAPPED))
 
-typedef long Align;
+typedef struct heap {
+  pthread_mutex_t lock;
+  size_t tag;           // heap bits for the head of each of its chunks
+  size_t grow;          // length of the next region to map
+  char *low;            // start of the last region mapped or extended
+  long mapped;          // regions mapped, for XV6_STATS
+  long extended;        // of those, how many extended the last one
+  Chunk *bins[NBINS];
+  // Bit i is set while bins[i] is non-empty.
+  unsigned long binmap[NWORDS];
+} Heap;
 
-union header {
-  struct {
-    union header *ptr;
-    unsigned int size;
-  } s;
-  Align x;
+#define HEAP_INIT(i)   { .lock = PTHREAD_MUTEX_INITIALIZER, .tag = (i) << 2, \
+                         .grow = MINGROW }
+
+static Heap heaps[NHEAPS] = {
+  HEAP_INIT(0), HEAP_INIT(1), HEAP_INIT(2), HEAP_INIT(3)
 };
 
-typedef union header Header;
+#define heap_of(c)     (&heaps[((c)->head & HEAPBITS) >> 2])
 
-static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
-static Header base;
-static Header *freep;
+// Threads take heaps in turn on their first allocation.
+static int next_heap;
+static __thread Heap *my_heap;
 
-static
-void
-xfree_helper(void *ap)
-{
-  Header *bp, *p;
-
-  bp = (Header*)ap - 1;
-  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if(bp + bp->s.size == p->s.ptr){
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  } else
-    bp->s.ptr = p->s.ptr;
-  if(p + p->s.size == bp){
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
-  freep = p;
+static int
+bin_index(size_t size)
+{
+  int fl;
+
+  if(size < NSMALL * ALIGN)
+    return size / ALIGN;
+  // NSMALL * ALIGN is 2^9.
+  fl = 63 - __builtin_clzl(size);
+  return NSMALL + (fl - 9) * NSUB + ((size >> (fl - SUBBITS)) & (NSUB - 1));
+}
+
+static void
+link_chunk(Heap *h, Chunk *c)
+{
+  int i = bin_index(chunksize(c));
+
+  c->prev = 0;
+  c->next = h->bins[i];
+  if(h->bins[i])
+    h->bins[i]->prev = c;
+  else
+    h->binmap[i / 64] |= 1UL << (i % 64);
+  h->bins[i] = c;
+}
+
+static void
+unlink_chunk(Heap *h, Chunk *c)
+{
+  int i;
+
+  if(c->prev)
+    c->prev->next = c->next;
+  else {
+    i = bin_index(chunksize(c));
+    if((h->bins[i] = c->next) == 0)
+      h->binmap[i / 64] &= ~(1UL << (i % 64));
+  }
+  if(c->next)
+    c->next->prev = c->prev;
+}
+
+// Marks c free with the given size and writes its footer.
+static void
+set_free(Heap *h, Chunk *c, size_t size)
+{
+  Chunk *n;
+
+  c->head = size | PINUSE | h->tag;
+  n = next_chunk(c);
+  n->prev_size = size;
+  n->head &= ~(size_t)PINUSE;
+}
+
+static void
+release_chunk(Heap *h, Chunk *c, size_t size)
+{
+  set_free(h, c, size);
+  link_chunk(h, c);
+}
+
+// Frees the chunk at ap into h and returns the free chunk it ends up in.
+static Chunk*
+xfree_helper(Heap *h, void *ap)
+{
+  Chunk *c, *n, *p;
+  size_t size;
+
+  c = mem2chunk(ap);
+  size = chunksize(c);
+  n = next_chunk(c);
+  if(!(n->head & CINUSE)){
+    unlink_chunk(h, n);
+    size += chunksize(n);
+  }
+  // Whatever is before the merged chunk is in use, or it would have
+  // merged with its own next chunk when it was freed.
+  if(!(c->head & PINUSE)){
+    p = prev_chunk(c);
+    size += chunksize(p);
+    if(bin_index(size) == bin_index(chunksize(p)))
+      set_free(h, p, size);
+    else {
+      unlink_chunk(h, p);
+      release_chunk(h, p, size);
+    }
+    return p;
+  }
+  release_chunk(h, c, size);
+  return c;
+}
+
+#define page_up(a)     ((char*)(((size_t)(a) + PAGE - 1) & ~(size_t)(PAGE - 1)))
+#define page_down(a)   ((char*)((size_t)(a) & ~(size_t)(PAGE - 1)))
+
+// Whether a free chunk over [a, b) is big enough to have had the whole
+// pages past its header and bin links dropped.
+static int
+trimmed(char *a, char *b)
+{
+  return page_down(b) > page_up(a + MINSIZE) &&
+         page_down(b) - page_up(a + MINSIZE) >= TRIMMIN;
+}
+
+// Before c is freed and merged with its free neighbours: if the merged
+// chunk will be big enough, finds its whole pages to drop, skipping
+// those inside a neighbour that was already big enough on its own.
+// They are dropped once the merge no longer needs the headers there.
+static void
+trim_range(Chunk *c, char **lop, char **hip)
+{
+  Chunk *n = next_chunk(c), *p = 0;
+  char *start = (char*)c, *end = (char*)n;
+  char *lo, *hi;
+
+  *lop = *hip = 0;
+  if(!(n->head & CINUSE))
+    end = (char*)next_chunk(n);
+  if(!(c->head & PINUSE))
+    start = (char*)(p = prev_chunk(c));
+  if(!trimmed(start, end))
+    return;
+
+  lo = page_up(start + MINSIZE);
+  hi = page_down(end);
+  if(p && trimmed((char*)p, (char*)c))
+    lo = page_down(c);
+  if(end != (char*)n && trimmed((char*)n, end))
+    hi = page_up((char*)n + MINSIZE);
+  if(hi > lo){
+    *lop = lo;
+    *hip = hi;
+  }
+}
+
+// Unmaps the region that free chunk c makes up all of, if it does. A
+// heap keeps its last region while that is small, so a thread that
+// frees and allocates in turn does not map and unmap every time.
+static void
+unmap_region(Heap *h, Chunk *c)
+{
+  Chunk *fence = next_chunk(c);
+  char *end = (char*)fence + HDR;
+
+  if(c->prev_size != FIRST || chunksize(fence) != HDR)
+    return;
+  if((char*)c == h->low && end - (char*)c <= MAXGROW)
+    return;
+  unlink_chunk(h, c);
+  if((char*)c == h->low)
+    h->low = 0;
+  munmap(c, end - (char*)c);
 }
 
 void
 xfree(void* ap)
 {
-  pthread_mutex_lock(&lock);
-  xfree_helper(ap);
-  pthread_mutex_unlock(&lock);
+  Chunk *c = mem2chunk(ap);
+  Heap *h;
+  char *lo, *hi;
+
+  if(is_mmapped(c)){
+    munmap(c, chunksize(c));
+    return;
+  }
+  h = heap_of(c);
+  pthread_mutex_lock(&h->lock);
+  trim_range(c, &lo, &hi);
+  c = xfree_helper(h, ap);
+  if(hi)
+    madvise(lo, hi - lo, MADV_DONTNEED);
+  unmap_region(h, c);
+  pthread_mutex_unlock(&h->lock);
+}
+
+// Maps a new region holding at least size bytes of free chunk. The
+// region ends in a header-only fencepost marked in use, so nothing
+// coalesces past it. If the region lands right below the last one, the
+// new chunk runs up to that region's first chunk instead, takes over
+// FIRST from it, and merges with it if it is free.
+static Chunk*
+morecore(Heap *h, size_t size)
+{
+  char *p, *want;
+  Chunk *c, *fence;
+  size_t len;
+
+  len = size + HDR;
+  if(len < h->grow)
+    len = h->grow;
+  len = (len + PAGE - 1) & ~(size_t)(PAGE - 1);
+  want = (size_t)h->low > len ? h->low - len : 0;
+  p = mmap(want, len, PROT_READ|PROT_WRITE,
+           MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+  if(p == MAP_FAILED)
+    return 0;
+  if(h->grow < MAXGROW)
+    h->grow *= 2;
+  h->mapped++;
+
+  c = (Chunk*)p;
+  c->prev_size = FIRST;
+  if(want && p == want){
+    h->extended++;
+    c->head = len | CINUSE | PINUSE | h->tag;
+  } else {
+    c->head = (len - HDR) | CINUSE | PINUSE | h->tag;
+    fence = (Chunk*)(p + len - HDR);
+    fence->head = HDR | CINUSE | h->tag;
+  }
+  h->low = p;
+  return xfree_helper(h, chunk2mem(c));
+}
+
+static void __attribute__((destructor))
+print_stats(void)
+{
+  long mapped = 0, extended = 0;
+  int i;
+
+  if(getenv("XV6_STATS") == 0)
+    return;
+  for(i = 0; i < NHEAPS; i++){
+    mapped += heaps[i].mapped;
+    extended += heaps[i].extended;
+  }
+  fprintf(stderr, "xv6_malloc: %ld regions mapped, %ld extended\n",
+          mapped, extended);
 }
 
-static Header*
-morecore(size_t nu)
+// Gives a large request a mapping of its own, outside every heap.
+static void*
+mmap_chunk(size_t size)
 {
   char *p;
-  Header *hp;
+  Chunk *c;
+  size_t len;
 
-  if(nu < 4096)
-    nu = 4096;
-  p = mmap(0, nu * sizeof(Header), PROT_READ|PROT_WRITE,
+  len = (size + PAGE - 1) & ~(size_t)(PAGE - 1);
+  p = mmap(0, len, PROT_READ|PROT_WRITE,
            MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
-  if(p == (char*)-1)
+  if(p == MAP_FAILED)
     return 0;
-  hp = (Header*)p;
-  hp->s.size = nu;
-  xfree_helper((void*)(hp + 1));
-  return freep;
+  c = (Chunk*)p;
+  c->prev_size = MMAPPED;
+  c->head = len | CINUSE;
+  return chunk2mem(c);
 }
 
+// First non-empty bin at or after bin i.
+static Chunk*
+first_bin_from(Heap *h, int i)
+{
+  unsigned long bits;
+  int w;
+
+  for(w = i / 64; w < NWORDS; w++, i = w * 64){
+    bits = h->binmap[w] & (~0UL << (i % 64));
+    if(bits)
+      return h->bins[w * 64 + __builtin_ctzl(bits)];
+  }
+  return 0;
+}
+
+#ifdef TLSF
+// Good fit in constant time: round size up to the start of the next bin,
+// so any chunk in that bin or later fits and no list is walked. When
+// that fails, only the head of the bin size itself falls in is tried
+// before mapping more memory, so the time taken stays bounded.
+static Chunk*
+find_fit(Heap *h, size_t size)
+{
+  Chunk *c;
+  size_t want;
+  int fl;
+
+  want = size;
+  if(size >= NSMALL * ALIGN){
+    fl = 63 - __builtin_clzl(size);
+    want += ((size_t)1 << (fl - SUBBITS)) - 1;
+  }
+  if((c = first_bin_from(h, bin_index(want))) != 0)
+    return c;
+  if((c = h->bins[bin_index(size)]) != 0 && chunksize(c) >= size)
+    return c;
+  return 0;
+}
+#else
+// First fit, starting from the bin for size. Only that bin can hold
+// chunks too small for size; the first one in any later bin will do.
+static Chunk*
+find_fit(Heap *h, size_t size)
+{
+  Chunk *c;
+  int i;
+
+  i = bin_index(size);
+  for(c = h->bins[i]; c; c = c->next)
+    if(chunksize(c) >= size)
+      return c;
+  return first_bin_from(h, i + 1);
+}
+#endif
+
 void*
 xmalloc(size_t nbytes)
 {
-  Header *p, *prevp;
-  unsigned int nunits;
+  Heap *h;
+  Chunk *c;
+  size_t size, rest;
 
-  pthread_mutex_lock(&lock);
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
-  if((prevp = freep) == 0){
-    base.s.ptr = freep = prevp = &base;
-    base.s.size = 0;
+  size = (nbytes + HDR + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+  if(size < MINSIZE)
+    size = MINSIZE;
+  if(size >= MMAPMIN)
+    return mmap_chunk(size);
+
+  if((h = my_heap) == 0)
+    h = my_heap = &heaps[__atomic_fetch_add(&next_heap, 1, __ATOMIC_RELAXED)
+                         % NHEAPS];
+
+  pthread_mutex_lock(&h->lock);
+  if((c = find_fit(h, size)) == 0 && (c = morecore(h, size)) == 0){
+    pthread_mutex_unlock(&h->lock);
+    return 0;
   }
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    if(p->s.size >= nunits){
-      if(p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
-      }
-      freep = prevp;
-      pthread_mutex_unlock(&lock);
-      return (void*)(p + 1);
-    }
-    if(p == freep) {
-      if((p = morecore(nunits)) == 0) {
-        pthread_mutex_unlock(&lock);
-        return 0;
-      }
-    }
+  if(chunksize(c) - size >= MINSIZE){
+    // Like K&R, hand out the tail end, so the rest stays where it is
+    // and only moves bins when it drops below its bin's range.
+    rest = chunksize(c) - size;
+    if(bin_index(rest) != bin_index(chunksize(c))){
+      unlink_chunk(h, c);
+      c->head = rest | PINUSE | h->tag;
+      link_chunk(h, c);
+    } else
+      c->head = rest | PINUSE | h->tag;
+    c = next_chunk(c);
+    c->prev_size = rest;
+    c->head = size | CINUSE | h->tag;
+  } else {
+    unlink_chunk(h, c);
+    c->head |= CINUSE;
   }
+  next_chunk(c)->head |= PINUSE;
+  pthread_mutex_unlock(&h->lock);
+  return chunk2mem(c);
 }
 
 void*
@@ -129,11 +474,10 @@ xrealloc(void* prev, size_t nn)
         
         // The contents will be unchanged in the range from the start of the
         // region up to the minimum of the old and new sizes.
-        Header* prev_head = ((Header*) prev) - 1;
-        unsigned int block_size = prev_head->s.size * sizeof(Header);
+        size_t block_size = chunksize(mem2chunk(prev)) - HDR;
         void* new_data = xmalloc(nn);
         if (block_size < nn) {
-            memcpy(new_data, prev, block_size - sizeof(Header));
+            memcpy(new_data, prev, block_size);
         } else {
             memcpy(new_data, prev, nn);
         }